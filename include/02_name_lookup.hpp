@@ -1,6 +0,0 @@
-#ifndef NAME_LOOKUP_HPP
-#define NAME_LOOKUP_HPP
-
-void name_lookup(void);
-
-#endif /* NAME_LOOKUP_HPP */
@@ -1,6 +0,0 @@
-#ifndef INITIALIZE_HPP
-#define INITIALIZE_HPP
-
-void initialize_things(void);
-
-#endif /* INITIALIZE_HPP */
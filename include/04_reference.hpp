@@ -1,6 +0,0 @@
-#ifndef REFERENCE_HPP
-#define REFERENCE_HPP
-
-void reference_semantics(void);
-
-#endif /* NAME_LOOKUP_HPP */
@@ -0,0 +1,302 @@
+#ifndef ALIGNED_BUFFER_HPP
+#define ALIGNED_BUFFER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * Typed, RAII owned and aligned storage. This is the C++ answer to the "(int *)malloc(n * sizeof(int))" idiom: the
+ * memory is typed, released on every path (including exceptions), aligned for SIMD loads and can optionally be backed
+ * by huge pages to cut TLB misses on large scans.
+ *
+ * Flags:
+ *   None        - cache line (64 byte) aligned heap memory.
+ *   PageAligned - page aligned anonymous mapping.
+ *   HugePages   - 2 MiB aligned mapping. MAP_HUGETLB is tried first, then madvise(MADV_HUGEPAGE) (transparent huge
+ *                 pages, only claimed when the kernel's THP mode is not "never"). When neither is configured, the
+ *                 buffer silently stays on normal pages. Check backing().
+ *   SmallPages  - page aligned mapping that opts out of transparent huge pages (MADV_NOHUGEPAGE).
+ *   Prefault    - touch every page at construction so page faults do not land in the hot loop.
+ *   Lock        - mlock() the buffer. Failure (e.g. RLIMIT_MEMLOCK) is not fatal, check locked().
+ */
+struct AlignedBufferFlags {
+	enum : unsigned {
+		None		= 0,
+		PageAligned	= 1u << 0,
+		HugePages	= 1u << 1,
+		SmallPages	= 1u << 2,
+		Prefault	= 1u << 3,
+		Lock		= 1u << 4,
+	};
+};
+
+enum class BufferBacking { Heap, Pages, TransparentHugePages, HugeTlb };
+
+inline const char *backing_name(BufferBacking b)
+{
+	switch (b) {
+	case BufferBacking::Heap:			return "heap";
+	case BufferBacking::Pages:			return "pages";
+	case BufferBacking::TransparentHugePages:	return "transparent huge pages";
+	case BufferBacking::HugeTlb:			return "hugetlb";
+	}
+	return "unknown";
+}
+
+/*
+ * Non-owning view over contiguous elements. Stands in for std::span, which is C++20.
+ */
+template <typename T>
+class Span {
+public:
+	Span() noexcept = default;
+	Span(T *data, std::size_t size) noexcept : m_data(data), m_size(size) { }
+
+	template <typename U, typename = std::enable_if_t<std::is_convertible<U (*)[], T (*)[]>::value>>
+	Span(const Span<U> &other) noexcept : m_data(other.data()), m_size(other.size()) { }
+
+	T *data() const noexcept { return m_data; }
+	std::size_t size() const noexcept { return m_size; }
+	std::size_t size_bytes() const noexcept { return m_size * sizeof(T); }
+	bool empty() const noexcept { return m_size == 0; }
+
+	T *begin() const noexcept { return m_data; }
+	T *end() const noexcept { return m_data + m_size; }
+	T &operator[](std::size_t i) const noexcept { return m_data[i]; }
+
+	Span subspan(std::size_t offset, std::size_t count) const noexcept
+	{
+		return Span(m_data + offset, count);
+	}
+
+private:
+	T *m_data = nullptr;
+	std::size_t m_size = 0;
+};
+
+template <typename T>
+class AlignedBuffer {
+public:
+	static constexpr std::size_t cache_line = 64;
+	static constexpr std::size_t huge_page = 2u << 20;
+
+	AlignedBuffer() noexcept = default;
+
+	explicit AlignedBuffer(std::size_t count, unsigned flags = AlignedBufferFlags::None)
+	{
+		static_assert(alignof(T) <= cache_line, "AlignedBuffer: over-aligned element type");
+
+		if (count == 0)
+			return;
+		if (count > SIZE_MAX / sizeof(T))
+			throw std::bad_alloc();
+
+		allocate(count * sizeof(T), flags);
+		m_size = count;
+
+		try {
+			if (!(std::is_trivially_default_constructible<T>::value && m_backing != BufferBacking::Heap))
+				std::uninitialized_value_construct_n(m_data, m_size); // mmap memory is already zero.
+		} catch (...) {
+			release();
+			throw;
+		}
+
+		if (flags & AlignedBufferFlags::Prefault)
+			prefault();
+		if (flags & AlignedBufferFlags::Lock)
+			m_locked = ::mlock(m_base, m_mapped) == 0;
+	}
+
+	AlignedBuffer(const AlignedBuffer &) = delete;
+	AlignedBuffer &operator=(const AlignedBuffer &) = delete;
+
+	AlignedBuffer(AlignedBuffer &&other) noexcept { swap(other); }
+
+	AlignedBuffer &operator=(AlignedBuffer &&other) noexcept
+	{
+		if (this != &other) {
+			AlignedBuffer tmp(std::move(other));
+			swap(tmp);
+		}
+		return *this;
+	}
+
+	~AlignedBuffer()
+	{
+		std::destroy_n(m_data, m_size);
+		release();
+	}
+
+	void swap(AlignedBuffer &other) noexcept
+	{
+		std::swap(m_data, other.m_data);
+		std::swap(m_size, other.m_size);
+		std::swap(m_base, other.m_base);
+		std::swap(m_mapped, other.m_mapped);
+		std::swap(m_backing, other.m_backing);
+		std::swap(m_locked, other.m_locked);
+	}
+
+	T *data() noexcept { return m_data; }
+	const T *data() const noexcept { return m_data; }
+	std::size_t size() const noexcept { return m_size; }
+	bool empty() const noexcept { return m_size == 0; }
+
+	T *begin() noexcept { return m_data; }
+	T *end() noexcept { return m_data + m_size; }
+	const T *begin() const noexcept { return m_data; }
+	const T *end() const noexcept { return m_data + m_size; }
+
+	T &operator[](std::size_t i) noexcept { return m_data[i]; }
+	const T &operator[](std::size_t i) const noexcept { return m_data[i]; }
+
+	Span<T> span() noexcept { return Span<T>(m_data, m_size); }
+	Span<const T> span() const noexcept { return Span<const T>(m_data, m_size); }
+
+	BufferBacking backing() const noexcept { return m_backing; }
+	bool locked() const noexcept { return m_locked; }
+
+private:
+	static std::size_t round_up(std::size_t n, std::size_t to) { return (n + to - 1) / to * to; }
+
+	/* round_up() for sizes: throws instead of wrapping to a tiny allocation near SIZE_MAX. */
+	static std::size_t round_up_size(std::size_t n, std::size_t to)
+	{
+		if (n > SIZE_MAX - (to - 1))
+			throw std::bad_alloc();
+		return round_up(n, to);
+	}
+
+	void allocate(std::size_t bytes, unsigned flags)
+	{
+		if (!(flags & (AlignedBufferFlags::PageAligned | AlignedBufferFlags::HugePages |
+				AlignedBufferFlags::SmallPages))) {
+			m_mapped = round_up_size(bytes, cache_line);
+			m_base = std::aligned_alloc(cache_line, m_mapped);
+			if (!m_base)
+				throw std::bad_alloc();
+			m_data = static_cast<T *>(m_base);
+			m_backing = BufferBacking::Heap;
+			return;
+		}
+
+		if ((flags & AlignedBufferFlags::HugePages) && map_huge(bytes))
+			return;
+
+		std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+		m_mapped = round_up_size(bytes, page);
+		m_base = map(m_mapped, 0);
+		if (!m_base)
+			throw std::bad_alloc();
+		m_data = static_cast<T *>(m_base);
+		m_backing = BufferBacking::Pages;
+#ifdef MADV_NOHUGEPAGE
+		if (flags & AlignedBufferFlags::SmallPages)
+			::madvise(m_base, m_mapped, MADV_NOHUGEPAGE);
+#endif
+	}
+
+	bool map_huge(std::size_t bytes)
+	{
+		std::size_t len = round_up_size(bytes, huge_page);
+		if (len > SIZE_MAX - huge_page) // The transparent huge page path over-maps by one huge page.
+			throw std::bad_alloc();
+#ifdef MAP_HUGETLB
+		if (void *p = map(len, MAP_HUGETLB)) {
+			m_base = p;
+			m_mapped = len;
+			m_data = static_cast<T *>(p);
+			m_backing = BufferBacking::HugeTlb;
+			return true;
+		}
+#endif
+#ifdef MADV_HUGEPAGE
+		/* Over-map by one huge page and trim, so the region starts on a 2 MiB boundary the kernel can back. */
+		char *raw = static_cast<char *>(map(len + huge_page, 0));
+		if (!raw)
+			return false;
+		char *aligned = reinterpret_cast<char *>(round_up(reinterpret_cast<std::uintptr_t>(raw), huge_page));
+		if (aligned != raw)
+			::munmap(raw, aligned - raw);
+		if (std::size_t tail = (raw + len + huge_page) - (aligned + len))
+			::munmap(aligned + len, tail);
+		m_base = aligned;
+		m_mapped = len;
+		m_data = reinterpret_cast<T *>(aligned);
+		/* madvise() also succeeds when THP is set to "never", so that alone does not mean huge pages. */
+		m_backing = ::madvise(aligned, len, MADV_HUGEPAGE) == 0 && thp_enabled() ?
+				BufferBacking::TransparentHugePages : BufferBacking::Pages;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	/* The selected mode is the bracketed word, e.g. "always [madvise] never". No file means no THP support. */
+	static bool thp_enabled() noexcept
+	{
+		int fd = ::open("/sys/kernel/mm/transparent_hugepage/enabled", O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return false;
+		char buf[64];
+		ssize_t n = ::read(fd, buf, sizeof(buf) - 1);
+		::close(fd);
+		if (n <= 0)
+			return false;
+		buf[n] = '\0';
+		const char *mode = std::strchr(buf, '[');
+		return mode && std::strncmp(mode, "[never]", 7) != 0;
+	}
+
+	static void *map(std::size_t len, int extra)
+	{
+		void *p = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extra, -1, 0);
+		return p == MAP_FAILED ? nullptr : p;
+	}
+
+	/* Steps by the small page size even on huge pages: THP can fall back to small pages at fault time. */
+	void prefault() noexcept
+	{
+		std::size_t step = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+		volatile char *p = static_cast<volatile char *>(m_base);
+		for (std::size_t off = 0; off < m_mapped; off += step)
+			p[off] = p[off]; // A write, so the page is really allocated and not mapped to the zero page.
+	}
+
+	void release() noexcept
+	{
+		if (!m_base)
+			return;
+		if (m_locked)
+			::munlock(m_base, m_mapped);
+		if (m_backing == BufferBacking::Heap)
+			std::free(m_base);
+		else
+			::munmap(m_base, m_mapped);
+		m_base = nullptr;
+		m_data = nullptr;
+		m_size = 0;
+		m_mapped = 0;
+		m_locked = false;
+	}
+
+	T *m_data = nullptr;
+	std::size_t m_size = 0;
+	void *m_base = nullptr;
+	std::size_t m_mapped = 0;
+	BufferBacking m_backing = BufferBacking::Heap;
+	bool m_locked = false;
+};
+
+#endif /* ALIGNED_BUFFER_HPP */
@@ -0,0 +1,41 @@
+#ifndef GUARDED_ALLOC_HPP
+#define GUARDED_ALLOC_HPP
+
+#include <cstddef>
+
+/*
+ * Sampling use-after-free / overflow detector (the GWP-ASan idea). The runner replaces the global operator new and
+ * delete. One allocation in about sample_rate is placed alone on a page of a guarded pool:
+ *
+ *   [guard][slot 0][guard][slot 1][guard] ... [slot n-1][guard]
+ *
+ * The allocation is pushed against the end of its slot (or randomly, the start), so running off it lands on a
+ * PROT_NONE guard page. A freed slot is made PROT_NONE and goes to the back of a FIFO quarantine, so a dangling pointer
+ * faults for as long as possible before the slot is reused. On SIGSEGV in the pool the report names the bug class and
+ * prints the allocation and free stacks, then the default action (crash, core dump) runs. Double and invalid frees of
+ * guarded pointers are reported and abort().
+ *
+ * All other allocations cost one thread local decrement on top of malloc(). Configuration is read from the
+ * environment at the first allocation:
+ *   CPP_NOTES_GUARD_RATE   sample one in N allocations, 0 (default) turns sampling off
+ *   CPP_NOTES_GUARD_SLOTS  number of guarded slots, default 256
+ *
+ * Only operator new/delete are hooked, not malloc(). Overflows smaller than the 16 byte alignment padding are not seen.
+ */
+namespace guarded_alloc {
+
+/* 0 turns sampling off. Takes effect on each thread at its next sampling decision. */
+void set_sample_rate(unsigned rate);
+unsigned sample_rate(void);
+
+/* Where a sampled allocation sits in its slot: against the end (overflows fault) or the start (underflows fault). */
+enum class Placement { Random, Right, Left };
+
+/* Sends the next allocation on this thread to the pool, even when sampling is off. For deterministic tests. */
+void force_next(Placement placement = Placement::Right);
+
+bool is_guarded(const void *p);
+
+}
+
+#endif /* GUARDED_ALLOC_HPP */
@@ -0,0 +1,36 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <cstddef>
+
+/*
+ * Built-in sampling profiler. A SIGPROF timer on process CPU time interrupts the program hz times a second and the
+ * signal handler copies the call stack into a preallocated buffer. Nothing is allocated or symbolized in the handler.
+ * After stop(), write_folded() symbolizes the samples (ELF symbol tables, so static functions resolve too) and writes
+ * one "outer;...;inner count" line per distinct stack, the input format of flamegraph.pl and speedscope.
+ *
+ * Clock::Cpu counts process CPU time, so idle time is not sampled. Those timers are checked on scheduler ticks, so the
+ * real rate is capped at the kernel's CONFIG_HZ (often 250). Clock::Wall is a high resolution CLOCK_MONOTONIC timer
+ * that delivers the requested rate, but also samples while the program sleeps or waits.
+ *
+ * write_folded() prints the effective rate next to the requested one and the measured handler overhead. When the
+ * kernel delivered noticeably fewer samples than requested, it adds the overhead at the requested rate, extrapolated
+ * from the per-sample cost. Use Clock::Wall to measure it instead.
+ *
+ * hz must be between 1 and max_hz. Above that the timer interval is shorter than the handler itself.
+ *
+ * Chapter objects must still be loaded when write_folded() runs, their addresses are resolved through them.
+ */
+namespace profiler {
+
+enum class Clock { Cpu, Wall };
+
+constexpr unsigned max_hz = 100000;
+
+bool start(unsigned hz = 1000, Clock clock = Clock::Cpu, std::size_t max_samples = 1u << 16);
+void stop(void);
+bool write_folded(const char *path);
+
+}
+
+#endif /* PROFILER_HPP */
@@ -0,0 +1,350 @@
+#ifndef SORTING_NETWORK_HPP
+#define SORTING_NETWORK_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Sorting networks: a fixed sequence of compare-exchange operations that sorts any input of size N. The sequence does
+ * not depend on the data, so there are no branches to mispredict and independent compare-exchanges can run in
+ * parallel (or in SIMD lanes).
+ *
+ * The networks are Batcher's odd-even merge sort, generated at compile time for 2 <= N <= 32. For N <= 8 they have
+ * the optimal comparator count (1, 3, 5, 9, 12, 16, 19). Above that they are not optimal, and the gap to the best
+ * known networks grows once N passes a power of two:
+ *
+ *   N          9   10   11   12   13   14   15   16   17   18   20   24   28   32
+ *   Batcher   28   32   38   42   48   53   59   63   85   90  103  132  162  191
+ *   best      25   29   35   39   45   51   56   60   71   78   91  120  155  185
+ *
+ * The best known networks are irregular search results. This file trades their comparators for a generator that
+ * fits in a few lines and a structure regular enough to reason about.
+ */
+namespace sorting_network {
+
+constexpr std::size_t max_size = 32;
+constexpr std::size_t max_comparators = 256; // Batcher's network for 32 has 191.
+
+struct CompareExchange {
+	unsigned char lo, hi;
+};
+
+struct Network {
+	std::array<CompareExchange, max_comparators> ce{};
+	std::size_t size = 0;
+};
+
+constexpr Network batcher(std::size_t n)
+{
+	Network net;
+	for (std::size_t p = 1; p < n; p *= 2)
+		for (std::size_t k = p; k >= 1; k /= 2)
+			for (std::size_t j = k % p; j + k < n; j += 2 * k)
+				for (std::size_t i = 0; i < std::min(k, n - j - k); i++)
+					if ((i + j) / (2 * p) == (i + j + k) / (2 * p))
+						net.ce[net.size++] = { static_cast<unsigned char>(i + j),
+								static_cast<unsigned char>(i + j + k) };
+	return net;
+}
+
+template <std::size_t N>
+inline constexpr Network network = batcher(N);
+
+/*
+ * 0-1 principle: a network sorts every input iff it sorts every input of zeros and ones. Cheap enough to check at
+ * compile time for the small sizes.
+ */
+constexpr bool sorts_all_binary_inputs(const Network &net, std::size_t n)
+{
+	for (std::uint32_t bits = 0; bits < (1u << n); bits++) {
+		std::uint32_t v = bits;
+		for (std::size_t c = 0; c < net.size; c++) {
+			std::uint32_t lo = (v >> net.ce[c].lo) & 1, hi = (v >> net.ce[c].hi) & 1;
+			if (lo > hi)
+				v ^= (1u << net.ce[c].lo) | (1u << net.ce[c].hi);
+		}
+		std::uint32_t ones = __builtin_popcount(v);
+		if (v != (((1u << n) - 1) ^ ((1u << (n - ones)) - 1))) // Sorted: all ones on the top indexes.
+			return false;
+	}
+	return true;
+}
+
+static_assert(network<8>.size == 19, "sorting_network: unexpected comparator count");
+static_assert(sorts_all_binary_inputs(network<8>, 8), "sorting_network: network<8> does not sort");
+static_assert(sorts_all_binary_inputs(network<12>, 12), "sorting_network: network<12> does not sort");
+
+/*
+ * Branchless compare-exchange. Same job as a conditional swap_ref(), but without the branch: floating point goes
+ * through std::min/std::max (minss/maxss), integers through conditional moves (cmov). Which spelling gcc keeps
+ * branch free differs between the two, see the comment in the body.
+ */
+template <typename T>
+inline void compare_exchange(T &a, T &b)
+{
+	if constexpr (std::is_floating_point<T>::value) {
+		T lo = std::min(a, b);
+		T hi = std::max(a, b);
+		a = lo;
+		b = hi;
+	} else {
+		/* gcc emits cmov for this form, but compiles std::min/std::max of integers to compare-and-jump. */
+		T lo = b < a ? b : a;
+		T hi = b < a ? a : b;
+		a = lo;
+		b = hi;
+	}
+}
+
+template <std::size_t N, typename T, std::size_t... I>
+inline void apply(T *v, std::index_sequence<I...>)
+{
+	(compare_exchange(v[network<N>.ce[I].lo], v[network<N>.ce[I].hi]), ...);
+}
+
+/* Sorts v[0..N) ascending. The whole network is unrolled at compile time. */
+template <std::size_t N, typename T>
+inline void sort(T *v)
+{
+	static_assert(N <= max_size, "sorting_network: N must be <= 32");
+	if constexpr (N >= 2)
+		apply<N>(v, std::make_index_sequence<network<N>.size>{});
+}
+
+/*
+ * SIMD: instead of sorting one array with a vector, sort W arrays at once, one per lane. Rows are "lane major":
+ * element i of array l is at v[i * W + l]. A compare-exchange is then one vector min and one vector max.
+ * transpose() turns W registers holding W elements of W arrays into W registers holding one element of each array.
+ */
+#if defined(__AVX2__)
+struct Int32x {
+	using reg = __m256i;
+	static constexpr std::size_t width = 8;
+	static reg load(const std::int32_t *p) { return _mm256_loadu_si256(reinterpret_cast<const reg *>(p)); }
+	static void store(std::int32_t *p, reg r) { _mm256_storeu_si256(reinterpret_cast<reg *>(p), r); }
+	static reg min(reg a, reg b) { return _mm256_min_epi32(a, b); }
+	static reg max(reg a, reg b) { return _mm256_max_epi32(a, b); }
+	/* 2x2 blocks of 32 bit, then of 64 bit elements within each 128 bit half, then swap the halves. */
+	static void transpose(reg *r)
+	{
+		reg t0 = _mm256_unpacklo_epi32(r[0], r[1]), t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+		reg t2 = _mm256_unpacklo_epi32(r[2], r[3]), t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+		reg t4 = _mm256_unpacklo_epi32(r[4], r[5]), t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+		reg t6 = _mm256_unpacklo_epi32(r[6], r[7]), t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+		reg s0 = _mm256_unpacklo_epi64(t0, t2), s1 = _mm256_unpackhi_epi64(t0, t2);
+		reg s2 = _mm256_unpacklo_epi64(t1, t3), s3 = _mm256_unpackhi_epi64(t1, t3);
+		reg s4 = _mm256_unpacklo_epi64(t4, t6), s5 = _mm256_unpackhi_epi64(t4, t6);
+		reg s6 = _mm256_unpacklo_epi64(t5, t7), s7 = _mm256_unpackhi_epi64(t5, t7);
+		r[0] = _mm256_permute2x128_si256(s0, s4, 0x20);
+		r[1] = _mm256_permute2x128_si256(s1, s5, 0x20);
+		r[2] = _mm256_permute2x128_si256(s2, s6, 0x20);
+		r[3] = _mm256_permute2x128_si256(s3, s7, 0x20);
+		r[4] = _mm256_permute2x128_si256(s0, s4, 0x31);
+		r[5] = _mm256_permute2x128_si256(s1, s5, 0x31);
+		r[6] = _mm256_permute2x128_si256(s2, s6, 0x31);
+		r[7] = _mm256_permute2x128_si256(s3, s7, 0x31);
+	}
+};
+
+struct Floatx {
+	using reg = __m256;
+	static constexpr std::size_t width = 8;
+	static reg load(const float *p) { return _mm256_loadu_ps(p); }
+	static void store(float *p, reg r) { _mm256_storeu_ps(p, r); }
+	static reg min(reg a, reg b) { return _mm256_min_ps(a, b); }
+	static reg max(reg a, reg b) { return _mm256_max_ps(a, b); }
+	/* Same steps as Int32x::transpose(). */
+	static void transpose(reg *r)
+	{
+		reg t0 = _mm256_unpacklo_ps(r[0], r[1]), t1 = _mm256_unpackhi_ps(r[0], r[1]);
+		reg t2 = _mm256_unpacklo_ps(r[2], r[3]), t3 = _mm256_unpackhi_ps(r[2], r[3]);
+		reg t4 = _mm256_unpacklo_ps(r[4], r[5]), t5 = _mm256_unpackhi_ps(r[4], r[5]);
+		reg t6 = _mm256_unpacklo_ps(r[6], r[7]), t7 = _mm256_unpackhi_ps(r[6], r[7]);
+		reg s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+		reg s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+		reg s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+		reg s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+		reg s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+		reg s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+		reg s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+		reg s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+		r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+		r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+		r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+		r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+		r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+		r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+		r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+		r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+	}
+};
+#elif defined(__SSE2__)
+struct Int32x {
+	using reg = __m128i;
+	static constexpr std::size_t width = 4;
+	static reg load(const std::int32_t *p) { return _mm_loadu_si128(reinterpret_cast<const reg *>(p)); }
+	static void store(std::int32_t *p, reg r) { _mm_storeu_si128(reinterpret_cast<reg *>(p), r); }
+#if defined(__SSE4_1__)
+	static reg min(reg a, reg b) { return _mm_min_epi32(a, b); }
+	static reg max(reg a, reg b) { return _mm_max_epi32(a, b); }
+#else
+	/* SSE2 has no 32 bit min/max, blend with a compare mask. */
+	static reg min(reg a, reg b)
+	{
+		reg gt = _mm_cmpgt_epi32(a, b);
+		return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+	}
+	static reg max(reg a, reg b)
+	{
+		reg gt = _mm_cmpgt_epi32(a, b);
+		return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+	}
+#endif
+	static void transpose(reg *r)
+	{
+		reg t0 = _mm_unpacklo_epi32(r[0], r[1]), t1 = _mm_unpacklo_epi32(r[2], r[3]);
+		reg t2 = _mm_unpackhi_epi32(r[0], r[1]), t3 = _mm_unpackhi_epi32(r[2], r[3]);
+		r[0] = _mm_unpacklo_epi64(t0, t1);
+		r[1] = _mm_unpackhi_epi64(t0, t1);
+		r[2] = _mm_unpacklo_epi64(t2, t3);
+		r[3] = _mm_unpackhi_epi64(t2, t3);
+	}
+};
+
+struct Floatx {
+	using reg = __m128;
+	static constexpr std::size_t width = 4;
+	static reg load(const float *p) { return _mm_loadu_ps(p); }
+	static void store(float *p, reg r) { _mm_storeu_ps(p, r); }
+	static reg min(reg a, reg b) { return _mm_min_ps(a, b); }
+	static reg max(reg a, reg b) { return _mm_max_ps(a, b); }
+	static void transpose(reg *r) { _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]); }
+};
+#else
+/* No SIMD: a "vector" of one lane, so the lane major functions still work. */
+template <typename T>
+struct ScalarLanes {
+	using reg = T;
+	static constexpr std::size_t width = 1;
+	static reg load(const T *p) { return *p; }
+	static void store(T *p, reg r) { *p = r; }
+	static reg min(reg a, reg b) { return b < a ? b : a; }
+	static reg max(reg a, reg b) { return b < a ? a : b; }
+	static void transpose(reg *) { }
+};
+using Int32x = ScalarLanes<std::int32_t>;
+using Floatx = ScalarLanes<float>;
+#endif
+
+template <typename T> struct lanes_for;
+template <> struct lanes_for<std::int32_t> { using type = Int32x; };
+template <> struct lanes_for<float> { using type = Floatx; };
+
+template <typename T>
+constexpr std::size_t lane_width = lanes_for<T>::type::width;
+
+template <typename V>
+inline void compare_exchange_lanes(typename V::reg &a, typename V::reg &b)
+{
+	typename V::reg lo = V::min(a, b);
+	b = V::max(a, b);
+	a = lo;
+}
+
+template <std::size_t N, typename V, std::size_t... I>
+inline void apply_lanes(typename V::reg *r, std::index_sequence<I...>)
+{
+	(compare_exchange_lanes<V>(r[network<N>.ce[I].lo], r[network<N>.ce[I].hi]), ...);
+}
+
+/* Loads or stores row I of r at p + I * stride. Folds, like apply(), so r can stay in registers. */
+template <typename V, typename T, std::size_t... I>
+inline void load_rows(typename V::reg *r, const T *p, std::size_t stride, std::index_sequence<I...>)
+{
+	((r[I] = V::load(p + I * stride)), ...);
+}
+
+template <typename V, typename T, std::size_t... I>
+inline void store_rows(T *p, std::size_t stride, const typename V::reg *r, std::index_sequence<I...>)
+{
+	(V::store(p + I * stride, r[I]), ...);
+}
+
+/* Sorts lane_width<T> arrays of N elements stored lane major in v[0..N * lane_width<T>). */
+template <std::size_t N, typename T>
+inline void sort_lanes(T *v)
+{
+	using V = typename lanes_for<T>::type;
+	static_assert(N <= max_size, "sorting_network: N must be <= 32");
+	typename V::reg r[N];
+	load_rows<V>(r, v, V::width, std::make_index_sequence<N>{});
+	if constexpr (N >= 2)
+		apply_lanes<N, V>(r, std::make_index_sequence<network<N>.size>{});
+	store_rows<V>(v, V::width, r, std::make_index_sequence<N>{});
+}
+
+/*
+ * Block B of a group of W arrays of N elements: elements [at, at + W) of each array, a W x W transpose away from
+ * rows [at, at + W) of the lane major registers. When W does not divide N the last block overlaps the one before it.
+ */
+template <std::size_t N, std::size_t W, std::size_t B>
+constexpr std::size_t block_at = B * W + W <= N ? B * W : N - W;
+
+template <std::size_t N, typename V, std::size_t B, typename T>
+inline void transpose_in(typename V::reg *r, const T *group)
+{
+	constexpr std::size_t at = block_at<N, V::width, B>;
+	load_rows<V>(r + at, group + at, N, std::make_index_sequence<V::width>{});
+	V::transpose(r + at);
+}
+
+template <std::size_t N, typename V, std::size_t B, typename T>
+inline void transpose_out(T *group, const typename V::reg *r)
+{
+	constexpr std::size_t at = block_at<N, V::width, B>;
+	typename V::reg block[V::width]; // A copy: an overlapping block still needs some of these rows untransposed.
+	std::copy(r + at, r + at + V::width, block);
+	V::transpose(block);
+	store_rows<V>(group + at, N, block, std::make_index_sequence<V::width>{});
+}
+
+template <std::size_t N, typename V, typename T, std::size_t... B>
+inline void sort_group(T *group, std::index_sequence<B...>)
+{
+	typename V::reg r[N];
+	(transpose_in<N, V, B>(r, group), ...);
+	apply_lanes<N, V>(r, std::make_index_sequence<network<N>.size>{});
+	(transpose_out<N, V, B>(group, r), ...);
+}
+
+/*
+ * Sorts count arrays of N elements each, stored one after another. Each group of W = lane_width<T> arrays is
+ * transposed W x W elements at a time into lane major registers (unpack and shuffle instructions, no trip through
+ * memory), sorted there and transposed back. Arrays shorter than W, and the arrays left over after the last full
+ * group, go through the scalar network.
+ */
+template <std::size_t N, typename T>
+inline void sort_batch(T *arrays, std::size_t count)
+{
+	using V = typename lanes_for<T>::type;
+	constexpr std::size_t W = V::width;
+	static_assert(N <= max_size, "sorting_network: N must be <= 32");
+	std::size_t a = 0;
+	if constexpr (N >= 2 && N >= W)
+		for (; a + W <= count; a += W)
+			sort_group<N, V>(arrays + a * N, std::make_index_sequence<(N + W - 1) / W>{});
+	for (; a < count; a++)
+		sort<N>(arrays + a * N);
+}
+
+} // namespace sorting_network
+
+#endif /* SORTING_NETWORK_HPP */
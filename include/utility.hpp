@@ -24,4 +24,16 @@
 		std::cout << "\033[0;36m" << "---> Function End\033[0m" << std::endl << std::endl; \
 	} while(0)
 
+/*
+ * Every chapter is built as its own shared object (build/NN_name.so) and loaded by the runner only when selected. The
+ * runner finds the chapter's top level function through this exported, unmangled symbol.
+ */
+#define CHAPTER_ENTRY "chapter_main"
+
+#define CHAPTER(func) \
+	extern "C" void chapter_main(void) \
+	{ \
+		func(); \
+	}
+
 #endif /* UTILITY_HPP */
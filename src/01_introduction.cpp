@@ -173,6 +173,8 @@ void func(const int *p)
 	//...
 }
 ---------------------------
+Casting the result of malloc only fixes the compile error. The memory is still untyped, leaks if an exception is
+thrown before free(), and is not aligned for SIMD. See AlignedBuffer<T> in "05_aligned_buffer.cpp" for the RAII way.
 
 18. typedef is needed for C while it is not in C++.
 ---------------------------
@@ -311,6 +313,8 @@ e.g.
 * Dividing by zero.
 * Using a non-constant expression in a case label in a switch statement in C++.
 * Changing a const variable in C. Changing a string literal in C and C++.
+Out of bounds accesses and dangling pointers on the heap can be caught in production by sampling, see
+"07_memory_errors.cpp".
 e.g. An interesting undefined behavior that is encountered a lot:
 ---------------------------
 char *p = "temp";
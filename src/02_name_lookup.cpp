@@ -65,10 +65,12 @@ static void interesting_name_lookup(void)
 
 ============================================================================== */
 
-void name_lookup(void)
+static void name_lookup(void)
 {
 	STARTT();
 	increasing_block_name_lookup();
 	interesting_name_lookup();
 	ENDT();
 }
+
+CHAPTER(name_lookup)
@@ -178,10 +178,12 @@ voud func(void)
 
 ============================================================================== */
 
-void initialize_things(void)
+static void initialize_things(void)
 {
 	STARTT();
 	print_zero_init();
 	print_garbage_init();
 	ENDT();
 }
+
+CHAPTER(initialize_things)
@@ -73,6 +73,8 @@ static void swap_cmp(void)
 
 /* ---------------------------
 
+Note: swap_ref() is the building block of sorting networks. See "06_sorting_network.cpp".
+
 e.g.
 --------------------------- */
 static int g = 10;
@@ -98,7 +100,7 @@ There cannot be a reference array in C++.
 
 ============================================================================== */
 
-void reference_semantics(void)
+static void reference_semantics(void)
 {
 	STARTT();
 	reference_init();
@@ -106,3 +108,5 @@ void reference_semantics(void)
 	return_ref_from_func();
 	ENDT();
 }
+
+CHAPTER(reference_semantics)
@@ -0,0 +1,154 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "utility.hpp"
+#include "aligned_buffer.hpp"
+
+/* ==============================================================================
+
+ALIGNED BUFFERS
+
+Item 17 of the introduction shows "int *p2 = (int *)malloc(n * sizeof(int));" as the C++ way of getting a dynamic int
+array. It compiles, but it is still C:
+* The memory is untyped. Nothing ties the pointer to the element count.
+* It leaks when an exception is thrown before the matching free().
+* malloc() only guarantees alignof(std::max_align_t) (16 bytes on x86-64). SIMD loads and cache line sized data
+want 64 bytes or more.
+
+"include/aligned_buffer.hpp" has AlignedBuffer<T>, an RAII owner with 64 byte, page or huge page alignment. It gives
+out Span<T> views (std::span is C++20) so functions can take a range without caring who owns it.
+e.g.
+--------------------------- */
+static double sum(Span<const double> s)
+{
+	double total = 0;
+	for (double d : s)
+		total += d;
+	return total;
+}
+
+static void malloc_vs_aligned(void)
+{
+	STARTF();
+	std::size_t n = 100;
+	int *p2 = (int *)malloc(n * sizeof(int));
+	std::cout << "malloc address % 64 = " << reinterpret_cast<std::uintptr_t>(p2) % 64 << std::endl;
+	free(p2); // Would be skipped if anything between malloc and free threw.
+
+	AlignedBuffer<int> ints(n);
+	std::cout << "AlignedBuffer address % 64 = " << reinterpret_cast<std::uintptr_t>(ints.data()) % 64 << std::endl;
+
+	AlignedBuffer<double> doubles(n, AlignedBufferFlags::PageAligned);
+	for (std::size_t i = 0; i < doubles.size(); i++)
+		doubles[i] = static_cast<double>(i);
+	std::cout << "sum of first 10 = " << sum(doubles.span().subspan(0, 10)) << std::endl;
+	std::cout << "backing = " << backing_name(doubles.backing()) << std::endl;
+	ENDF();
+}
+/* ---------------------------
+
+Huge pages: the CPU caches virtual to physical translations in the TLB, which only has a few thousand entries. With
+4 KiB pages a 1 GiB buffer needs 262144 translations, with 2 MiB pages it needs 512. Scans over multi-GB buffers,
+especially ones that jump around, spend a lot of time on page walks when the pages are small.
+
+AlignedBufferFlags::HugePages tries MAP_HUGETLB first (needs pages reserved in /proc/sys/vm/nr_hugepages), then
+transparent huge pages through madvise(MADV_HUGEPAGE). If neither is available the buffer stays on normal pages and
+backing() tells you so. Prefault moves the page faults out of the measured loop, Lock keeps the buffer in RAM.
+
+Independent random loads hide most of this: the CPU keeps many misses, and their page walks, in flight at once. A
+pointer chase, where the address of each load comes from the previous one, pays every TLB miss and page walk in full.
+
+e.g. A random cyclic pointer chase (one node per cache line) and a sequential scan over the same buffer on small and
+on huge pages. The chase time difference is the page walk cost. Size can be changed with the CPP_NOTES_SCAN_MB
+environment variable.
+--------------------------- */
+template <typename F>
+static double time_ms(F &&f)
+{
+	auto start = std::chrono::steady_clock::now();
+	f();
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+constexpr std::size_t node_stride = 64 / sizeof(std::uint64_t);
+
+/* Sattolo's algorithm: a random permutation that is a single cycle, so the chase visits every node. */
+static std::vector<std::uint32_t> random_cycle(std::size_t nodes)
+{
+	std::vector<std::uint32_t> order(nodes);
+	for (std::size_t i = 0; i < nodes; i++)
+		order[i] = static_cast<std::uint32_t>(i);
+	std::mt19937_64 gen(42);
+	for (std::size_t i = nodes - 1; i > 0; i--)
+		std::swap(order[i], order[std::uniform_int_distribution<std::size_t>(0, i - 1)(gen)]);
+	return order;
+}
+
+static std::uint64_t pointer_chase(Span<const std::uint64_t> s, std::size_t steps)
+{
+	std::uint64_t i = 0;
+	for (std::size_t k = 0; k < steps; k++)
+		i = s[i]; // The next address depends on this load.
+	return i;
+}
+
+static void scan_benchmark(void)
+{
+	STARTF();
+	std::size_t mb = 128;
+	if (const char *env = std::getenv("CPP_NOTES_SCAN_MB")) {
+		char *end;
+		unsigned long v = std::strtoul(env, &end, 10);
+		/* At least 1 MiB (a chase needs two nodes), and small enough that the byte count does not overflow. */
+		if (end != env && *end == '\0' && v >= 1 && v <= (SIZE_MAX >> 20))
+			mb = v;
+		else
+			std::cerr << "CPP_NOTES_SCAN_MB=\"" << env << "\" is not a size in MiB, using " << mb << std::endl;
+	}
+	std::size_t count = (mb << 20) / sizeof(std::uint64_t);
+	std::size_t nodes = count / node_stride;
+	std::size_t steps = 1u << 20;
+	std::vector<std::uint32_t> order = random_cycle(nodes);
+
+	struct {
+		const char *name;
+		unsigned flags;
+	} runs[] = {
+		{ "small pages", AlignedBufferFlags::SmallPages | AlignedBufferFlags::Prefault },
+		{ "huge pages ", AlignedBufferFlags::HugePages | AlignedBufferFlags::Prefault },
+	};
+
+	for (const auto &run : runs) {
+		AlignedBuffer<std::uint64_t> buf(count, run.flags);
+		for (std::size_t k = 0; k < nodes; k++)
+			buf[order[k] * node_stride] = order[(k + 1) % nodes] * node_stride;
+		std::uint64_t seq = 0, end = 0;
+		double seq_ms = time_ms([&] {
+			for (std::uint64_t v : buf.span())
+				seq += v;
+		});
+		double chase_ms = time_ms([&] { end = pointer_chase(buf.span(), steps); });
+		std::cout << run.name << " (" << backing_name(buf.backing()) << "): " << mb << " MiB sequential "
+			<< seq_ms << " ms, " << steps << " dependent loads " << chase_ms << " ms ("
+			<< chase_ms * 1e6 / steps << " ns each, checksum " << (seq ^ end) % 1000 << ")" << std::endl;
+	}
+	ENDF();
+}
+/* ---------------------------
+
+============================================================================== */
+
+static void aligned_buffer(void)
+{
+	STARTT();
+	malloc_vs_aligned();
+	scan_benchmark();
+	ENDT();
+}
+
+CHAPTER(aligned_buffer)
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <random>
+
+#include "utility.hpp"
+#include "aligned_buffer.hpp"
+#include "sorting_network.hpp"
+
+/* ==============================================================================
+
+SORTING NETWORKS
+
+swap_ref() in "04_reference.cpp" swaps two objects through references. Swapping two elements only when they are out of
+order is a compare-exchange, and a fixed list of compare-exchanges that sorts every input of size N is a sorting
+network. e.g. The optimal network for 4 elements has 5 compare-exchanges:
+---------------------------
+void sort4(int &a, int &b, int &c, int &d)
+{
+	if (b < a) swap_ref(a, b);
+	if (d < c) swap_ref(c, d);
+	if (c < a) swap_ref(a, c);
+	if (d < b) swap_ref(b, d);
+	if (c < b) swap_ref(b, c);
+}
+---------------------------
+
+The "if" is a branch on random data, which the CPU mispredicts about half the time. The compare-exchange in
+sorting_network.hpp has no branch: floats use std::min/std::max, which gcc compiles to minss/maxss. For integers gcc
+compiles std::min/std::max to compare-and-jump but "b < a ? b : a" to cmov, so integers use that form.
+
+"include/sorting_network.hpp" generates the networks for N <= 32 at compile time (constexpr Batcher odd-even merge
+sort) and unrolls them with a fold expression over std::index_sequence, so sorting_network::sort<N>(p) is straight
+line code. The 0-1 principle is checked with static_assert for the small sizes.
+
+e.g.
+--------------------------- */
+static void sort_small(void)
+{
+	STARTF();
+	int a[5] = {42, 7, 19, 3, 25};
+	sorting_network::sort<5>(a);
+	for (int x : a)
+		std::cout << x << " ";
+	std::cout << std::endl;
+	std::cout << "network<5> has " << sorting_network::network<5>.size << " compare-exchanges, network<32> has "
+		<< sorting_network::network<32>.size << std::endl;
+	ENDF();
+}
+/* ---------------------------
+
+SIMD variants: a network does the same operations for every input, so W independent arrays can be sorted at once by
+putting array l in lane l of the vectors. sort_lanes<N>() takes the arrays lane major, sort_batch<N>() takes them one
+after another and transposes groups of W in registers (unpack and shuffle instructions). W is 8 with AVX2 and 4 with
+SSE2, for int32 and float. The Makefile builds this chapter with -march=native, so the widest one this CPU has is used.
+
+The transpose is not free: it costs about as many shuffles as the network has compare-exchanges for small N. Data
+that is already lane major (e.g. a structure of arrays) skips it, the "lanes" column. For arrays shorter than W,
+sort_batch() uses the scalar network.
+
+e.g. Many small arrays, the shape of top-K and median filter windows. ns per array for each method.
+--------------------------- */
+template <typename T>
+static void insertion_sort(T *v, std::size_t n)
+{
+	for (std::size_t i = 1; i < n; i++) {
+		T x = v[i];
+		std::size_t j = i;
+		for (; j > 0 && x < v[j - 1]; j--)
+			v[j] = v[j - 1];
+		v[j] = x;
+	}
+}
+
+template <typename F>
+static double ns_per_array(std::size_t count, F &&f)
+{
+	auto start = std::chrono::steady_clock::now();
+	f();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / count;
+}
+
+template <std::size_t N, typename T>
+static void benchmark(const char *type)
+{
+	const std::size_t count = 1u << 15;
+	AlignedBuffer<T> input(count * N), work(count * N);
+	std::mt19937 gen(N);
+	std::uniform_int_distribution<int> dist(-1000000, 1000000);
+	for (T &x : input)
+		x = static_cast<T>(dist(gen));
+
+	auto run = [&](auto &&sorter) {
+		std::copy(input.begin(), input.end(), work.begin());
+		double ns = ns_per_array(count, sorter);
+		for (std::size_t a = 0; a < count; a++)
+			if (!std::is_sorted(work.data() + a * N, work.data() + (a + 1) * N))
+				return -1.0;
+		return ns;
+	};
+
+	double std_ns = run([&] {
+		for (std::size_t a = 0; a < count; a++)
+			std::sort(work.data() + a * N, work.data() + (a + 1) * N);
+	});
+	double ins_ns = run([&] {
+		for (std::size_t a = 0; a < count; a++)
+			insertion_sort(work.data() + a * N, N);
+	});
+	double net_ns = run([&] {
+		for (std::size_t a = 0; a < count; a++)
+			sorting_network::sort<N>(work.data() + a * N);
+	});
+	double simd_ns = run([&] { sorting_network::sort_batch<N>(work.data(), count); });
+
+	/* Same arrays, laid out lane major before the clock starts and back afterwards for the check. */
+	constexpr std::size_t W = sorting_network::lane_width<T>;
+	AlignedBuffer<T> lanes(count * N);
+	double lanes_ns = 0;
+	bool lanes_sorted = run([&] {
+		for (std::size_t a = 0; a < count; a++)
+			for (std::size_t i = 0; i < N; i++)
+				lanes[(a / W * N + i) * W + a % W] = work[a * N + i];
+		lanes_ns = ns_per_array(count, [&] {
+			for (std::size_t a = 0; a + W <= count; a += W)
+				sorting_network::sort_lanes<N>(lanes.data() + a * N);
+		});
+		for (std::size_t a = 0; a < count; a++)
+			for (std::size_t i = 0; i < N; i++)
+				work[a * N + i] = lanes[(a / W * N + i) * W + a % W];
+	}) >= 0;
+	if (!lanes_sorted)
+		lanes_ns = -1;
+
+	std::cout << type << " N = " << N << ": std::sort " << std_ns << ", insertion " << ins_ns << ", network "
+		<< net_ns << ", x" << W << " batch " << simd_ns << ", x" << W << " lanes " << lanes_ns << std::endl;
+}
+
+static void network_benchmark(void)
+{
+	STARTF();
+	benchmark<4, std::int32_t>("int32");
+	benchmark<8, std::int32_t>("int32");
+	benchmark<16, std::int32_t>("int32");
+	benchmark<32, std::int32_t>("int32");
+	benchmark<8, float>("float");
+	benchmark<16, float>("float");
+	ENDF();
+}
+/* ---------------------------
+
+Note: A result of -1 means the method did not sort. It should never show up.
+
+============================================================================== */
+
+static void sorting_networks(void)
+{
+	STARTT();
+	sort_small();
+	network_benchmark();
+	ENDT();
+}
+
+CHAPTER(sorting_networks)
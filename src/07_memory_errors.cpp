@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "utility.hpp"
+#include "guarded_alloc.hpp"
+
+/* ==============================================================================
+
+CATCHING MEMORY ERRORS IN PRODUCTION
+
+The undefined behavior list at the end of the introduction has "Accessing an array beyond its bounds" and "Accessing
+memory after it has been deallocated (a dangling pointer)". Both usually go unnoticed: the memory is still mapped, so
+the program reads stale data or overwrites a neighbour and fails much later somewhere else.
+
+AddressSanitizer (-fsanitize=address) catches every such access but makes the program about 2x slower and uses much
+more memory, so it is run in tests, not under production load. A sampling detector (the GWP-ASan idea) checks only a
+tiny random fraction of allocations, but checks them in production, where the real inputs are:
+
+* A sampled allocation is placed alone on a page, pushed against a PROT_NONE guard page. Running off its end faults.
+* When it is deleted, its page becomes PROT_NONE too and waits in a quarantine. A dangling pointer to it faults.
+* The fault handler knows the allocation and free call stacks of the slot, and prints them.
+
+Over many machines and many hours, even a 1 in 10000 sample finds the bugs that happen regularly. The runner
+replaces the global operator new/delete with one (see "include/guarded_alloc.hpp"). CPP_NOTES_GUARD_RATE=N samples
+one in N allocations.
+
+e.g. guarded_alloc::force_next() sends the next allocation to the pool, so every bug class can be triggered
+deterministically. Each one runs in a child process, since a detected bug ends the process.
+--------------------------- */
+/*
+ * Runs bug() in a child with stderr on a pipe. It counts as caught only if the child died and the detector printed
+ * "==guarded_alloc== <expected>", so a crash from anything else (e.g. glibc's own double free check) does not pass.
+ */
+static bool expect_report(const char *name, const char *expected, void (*bug)(void))
+{
+	std::cout << "--- " << name << std::endl;
+	int fds[2];
+	if (pipe(fds) != 0)
+		return false;
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		dup2(fds[1], STDERR_FILENO);
+		bug();
+		_exit(0);
+	}
+	close(fds[1]);
+	std::string report;
+	char buf[4096];
+	for (ssize_t n; (n = read(fds[0], buf, sizeof(buf))) > 0; )
+		report.append(buf, n);
+	close(fds[0]);
+	int status = 0;
+	waitpid(pid, &status, 0);
+
+	std::cout << report;
+	bool caught = WIFSIGNALED(status) && report.find(std::string("==guarded_alloc== ") + expected) !=
+			std::string::npos;
+	std::cout << name << ": " << (caught ? "caught" : "NOT caught") << std::endl;
+	return caught;
+}
+
+/* A forced allocation that fell back to malloc() would make the bug below undetectable, fail loudly instead. */
+static void require_guarded(const volatile void *p)
+{
+	if (!guarded_alloc::is_guarded(const_cast<const void *>(p))) {
+		std::cerr << "allocation is not guarded, the pool is disabled or full" << std::endl;
+		_exit(2);
+	}
+}
+
+static void use_after_free(void)
+{
+	guarded_alloc::force_next();
+	volatile int *p = new int[10];
+	require_guarded(p);
+	delete[] p;
+	p[3] = 42; // Dangling pointer write.
+}
+
+static void read_after_free(void)
+{
+	guarded_alloc::force_next();
+	std::vector<int> *volatile v = new std::vector<int>(4);
+	require_guarded(v);
+	delete v;
+	std::cout << v->size() << std::endl; // Dangling pointer read.
+}
+
+static void heap_overflow(void)
+{
+	guarded_alloc::force_next(guarded_alloc::Placement::Right);
+	volatile char *p = new char[40];
+	require_guarded(p);
+	for (int i = 0; i < 64; i++) // Off the end. The first 8 bytes past it are alignment padding and go unseen.
+		p[i] = 'x';
+	delete[] p;
+}
+
+static void heap_underflow(void)
+{
+	guarded_alloc::force_next(guarded_alloc::Placement::Left);
+	volatile char *p = new char[40];
+	require_guarded(p);
+	p[-1] = 'x';
+	delete[] p;
+}
+
+static void double_free(void)
+{
+	guarded_alloc::force_next();
+	int *volatile p = new int(5);
+	require_guarded(p);
+	delete p;
+	delete p;
+}
+
+static void detect_bug_classes(void)
+{
+	STARTF();
+	int caught = expect_report("use-after-free write", "use-after-free", use_after_free);
+	caught += expect_report("use-after-free read", "use-after-free", read_after_free);
+	caught += expect_report("heap buffer overflow", "buffer overflow", heap_overflow);
+	caught += expect_report("heap buffer underflow", "buffer underflow", heap_underflow);
+	caught += expect_report("double free", "double free", double_free);
+	std::cout << caught << " of 5 bug classes caught" << std::endl;
+	ENDF();
+}
+/* ---------------------------
+
+The price is paid only on the sampled allocations (two mprotect() calls and two stack captures). Every other new
+costs one thread local decrement. So the rate is what keeps the overhead low. An allocation heavy loop is close to
+the worst case:
+--------------------------- */
+static double new_delete_ms(unsigned rate)
+{
+	guarded_alloc::set_sample_rate(rate);
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < 250000; i++) {
+		volatile char *p = new char[24 + i % 64];
+		p[0] = 1;
+		delete[] p;
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+/*
+ * One run is too noisy to show a 1% difference, and the machine's speed drifts between runs. After a warm-up pass,
+ * every round runs all rates back to back in a rotated order (so none always runs first), and each rate is compared
+ * with the "off" run of the same round. The median of those per round ratios is reported.
+ */
+static void sampling_overhead(void)
+{
+	STARTF();
+	const unsigned rates[] = { 0, 1000, 10000, 100000 };
+	const std::size_t n_rates = sizeof(rates) / sizeof(rates[0]);
+	const std::size_t rounds = 31;
+	unsigned configured = guarded_alloc::sample_rate();
+
+	for (unsigned rate : rates)
+		new_delete_ms(rate);
+	std::vector<double> off_ms, ratio[n_rates];
+	for (std::size_t r = 0; r < rounds; r++) {
+		double ms[n_rates];
+		for (std::size_t k = 0; k < n_rates; k++) {
+			std::size_t i = (r + k) % n_rates;
+			ms[i] = new_delete_ms(rates[i]);
+		}
+		off_ms.push_back(ms[0]);
+		for (std::size_t i = 1; i < n_rates; i++)
+			ratio[i].push_back(ms[i] / ms[0]);
+	}
+	guarded_alloc::set_sample_rate(configured);
+
+	auto median = [](std::vector<double> &v) {
+		std::sort(v.begin(), v.end());
+		return v[v.size() / 2];
+	};
+	std::cout << "off: " << median(off_ms) << " ms for 250k new/delete (median of " << rounds << " rounds)"
+		<< std::endl;
+	double overhead[n_rates] = {};
+	for (std::size_t i = 1; i < n_rates; i++) {
+		overhead[i] = median(ratio[i]) - 1;
+		std::cout << "1 in " << rates[i] << ": " << 100.0 * overhead[i] << "% overhead" << std::endl;
+	}
+
+	/*
+	 * At the low rates the overhead is below the noise left after all of the above. The 1 in 1000 row is well above it,
+	 * so the cost of one sampled allocation is taken from there and the rest is arithmetic: overhead = cost / (rate *
+	 * cost of a normal allocation).
+	 */
+	double alloc_ns = median(off_ms) * 1e6 / 250000;
+	double sampled_ns = overhead[1] * rates[1] * alloc_ns;
+	std::cout << "one sampled allocation costs about " << sampled_ns / 1000 << " us vs " << alloc_ns
+		<< " ns for a normal one, so this loop stays under 1% from 1 in " << static_cast<unsigned>(sampled_ns /
+		(0.01 * alloc_ns)) << std::endl;
+	ENDF();
+}
+/* ---------------------------
+
+Note: Only operator new/delete are hooked. Memory from malloc() is not sampled.
+
+============================================================================== */
+
+static void memory_errors(void)
+{
+	STARTT();
+	detect_bug_classes();
+	sampling_overhead();
+	ENDT();
+}
+
+CHAPTER(memory_errors)
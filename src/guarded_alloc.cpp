@@ -0,0 +1,406 @@
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <execinfo.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "guarded_alloc.hpp"
+
+namespace guarded_alloc {
+
+namespace {
+
+constexpr int stack_depth = 16;
+constexpr std::size_t alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+constexpr std::uint32_t recheck_disabled = 4096; // Allocations between looks at a zero rate.
+
+enum class SlotState : unsigned char { Unused, Allocated, Freed };
+
+struct Slot {
+	std::uintptr_t ptr;
+	std::size_t size;
+	SlotState state;
+	int alloc_depth, free_depth;
+	void *alloc_stack[stack_depth];
+	void *free_stack[stack_depth];
+};
+
+/*
+ * All state is plain static storage or mmap()ed, never operator new, which would recurse. Pool operations are rare
+ * (only sampled allocations) and take a spin lock.
+ */
+std::atomic<unsigned> rate{0};
+std::atomic<int> init_state{0}; // 0 not started, 1 in progress, 2 done
+std::atomic_flag lock = ATOMIC_FLAG_INIT;
+
+std::size_t page;
+std::size_t slot_count;
+char *pool;
+std::size_t pool_size;
+Slot *slots;
+std::size_t *quarantine;	// FIFO ring of slot indexes available for reuse, oldest first
+std::size_t q_head, q_len;
+bool pool_ready;
+struct sigaction old_segv;
+
+thread_local std::uint64_t countdown = 1;
+thread_local bool forced;
+thread_local Placement forced_placement;
+thread_local std::uint32_t rng = 0x9e3779b9u;
+
+struct Guard {
+	Guard() { while (lock.test_and_set(std::memory_order_acquire)) { } }
+	~Guard() { lock.clear(std::memory_order_release); }
+};
+
+std::uint32_t next_random(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+/* Uniform in [1, 2r], so the sampled allocations are not predictable but average one in r. 64 bit, 2r can exceed 2^32. */
+std::uint64_t next_countdown(unsigned r)
+{
+	if (r == 0)
+		return recheck_disabled;
+	std::uint64_t bits = static_cast<std::uint64_t>(next_random()) << 32 | next_random();
+	return 1 + bits % (2 * static_cast<std::uint64_t>(r));
+}
+
+/* Async-signal-safe output helpers for the fault report. */
+void put(const char *s)
+{
+	ssize_t r = write(STDERR_FILENO, s, std::strlen(s));
+	(void)r;
+}
+
+void put_num(std::uintptr_t v, unsigned base)
+{
+	char buf[24];
+	char *p = buf + sizeof(buf);
+	*--p = '\0';
+	do {
+		*--p = "0123456789abcdef"[v % base];
+		v /= base;
+	} while (v);
+	if (base == 16)
+		put("0x");
+	put(p);
+}
+
+void put_stack(const char *title, void *const *stack, int depth)
+{
+	put(title);
+	put("\n");
+	backtrace_symbols_fd(stack, depth, STDERR_FILENO);
+}
+
+bool in_pool(std::uintptr_t addr)
+{
+	return pool_ready && addr >= reinterpret_cast<std::uintptr_t>(pool) &&
+		addr < reinterpret_cast<std::uintptr_t>(pool) + pool_size;
+}
+
+/* Pool page k: even pages are guards, odd page 2i+1 is slot i. */
+char *slot_page(std::size_t i)
+{
+	return pool + (2 * i + 1) * page;
+}
+
+void describe(const char *what, std::uintptr_t addr, const Slot &s)
+{
+	put("==guarded_alloc== ");
+	put(what);
+	put(" at ");
+	put_num(addr, 16);
+	put(", ");
+	if (addr >= s.ptr + s.size) {
+		put_num(addr - (s.ptr + s.size), 10);
+		put(" bytes after");
+	} else if (addr < s.ptr) {
+		put_num(s.ptr - addr, 10);
+		put(" bytes before");
+	} else {
+		put_num(addr - s.ptr, 10);
+		put(" bytes into");
+	}
+	put(" a ");
+	put_num(s.size, 10);
+	put(" byte allocation at ");
+	put_num(s.ptr, 16);
+	put("\n");
+	put_stack("allocated by:", s.alloc_stack, s.alloc_depth);
+	if (s.state == SlotState::Freed)
+		put_stack("freed by:", s.free_stack, s.free_depth);
+}
+
+void on_segv(int sig, siginfo_t *info, void *ctx)
+{
+	std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(info->si_addr);
+	if (in_pool(addr)) {
+		std::size_t index = (addr - reinterpret_cast<std::uintptr_t>(pool)) / page;
+		const char *access = "access";
+#if defined(__x86_64__)
+		auto *uc = static_cast<ucontext_t *>(ctx);
+		access = uc->uc_mcontext.gregs[REG_ERR] & 2 ? "write" : "read";
+#else
+		(void)ctx;
+#endif
+		put("==guarded_alloc== invalid ");
+		put(access);
+		put("\n");
+		if (index % 2 == 1) {
+			const Slot &s = slots[index / 2];
+			describe(s.state == SlotState::Freed ? "use-after-free" : "wild access to an unused slot", addr, s);
+		} else {
+			/* A guard page. Blame the closer of the two neighbouring live allocations. */
+			std::size_t guard = index / 2;
+			const Slot *left = guard > 0 ? &slots[guard - 1] : nullptr;
+			const Slot *right = guard < slot_count ? &slots[guard] : nullptr;
+			if (left && left->state != SlotState::Allocated)
+				left = nullptr;
+			if (right && right->state != SlotState::Allocated)
+				right = nullptr;
+			if (left && (!right || addr - (left->ptr + left->size) <= right->ptr - addr))
+				describe("buffer overflow", addr, *left);
+			else if (right)
+				describe("buffer underflow", addr, *right);
+			else
+				put("==guarded_alloc== access to a guard page with no live neighbour\n");
+		}
+	}
+	/* Not ours, or reported: let the previous handler (by default, a crash) deal with the retried access. */
+	sigaction(sig, &old_segv, nullptr);
+}
+
+void *map_zeroed(std::size_t bytes, int prot)
+{
+	void *p = mmap(nullptr, bytes, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return p == MAP_FAILED ? nullptr : p;
+}
+
+void init(void)
+{
+	int expected = 0;
+	if (!init_state.compare_exchange_strong(expected, 1)) {
+		while (init_state.load() != 2) { }
+		return;
+	}
+	if (const char *env = std::getenv("CPP_NOTES_GUARD_RATE"))
+		rate = static_cast<unsigned>(std::min<unsigned long>(std::strtoul(env, nullptr, 10), UINT_MAX));
+	slot_count = 256;
+	if (const char *env = std::getenv("CPP_NOTES_GUARD_SLOTS"))
+		slot_count = std::strtoul(env, nullptr, 10);
+
+	page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+	pool_size = (2 * slot_count + 1) * page;
+	if (slot_count) {
+		pool = static_cast<char *>(map_zeroed(pool_size, PROT_NONE));
+		slots = static_cast<Slot *>(map_zeroed(slot_count * sizeof(Slot), PROT_READ | PROT_WRITE));
+		quarantine = static_cast<std::size_t *>(map_zeroed(slot_count * sizeof(std::size_t),
+				PROT_READ | PROT_WRITE));
+	}
+	if (pool && slots && quarantine) {
+		for (std::size_t i = 0; i < slot_count; i++)
+			quarantine[i] = i;
+		q_len = slot_count;
+
+		void *warm[1];
+		backtrace(warm, 1); // Loads the unwinder now, not in the middle of an allocation.
+
+		struct sigaction sa = {};
+		sa.sa_sigaction = on_segv;
+		sa.sa_flags = SA_SIGINFO;
+		sigemptyset(&sa.sa_mask);
+		pool_ready = sigaction(SIGSEGV, &sa, &old_segv) == 0;
+	}
+	init_state = 2;
+}
+
+void *guarded_alloc(std::size_t size, Placement placement)
+{
+	if (size > page)
+		return nullptr;
+	Guard g;
+	if (q_len == 0)
+		return nullptr;
+	std::size_t i = quarantine[q_head];
+	q_head = (q_head + 1) % slot_count;
+	q_len--;
+
+	char *base = slot_page(i);
+	if (mprotect(base, page, PROT_READ | PROT_WRITE) != 0)
+		return nullptr;
+	Slot &s = slots[i];
+	std::size_t rounded = ((size ? size : 1) + alignment - 1) / alignment * alignment;
+	/* Mostly right aligned to catch overflows, sometimes left aligned to catch underflows. */
+	bool left = placement == Placement::Left || (placement == Placement::Random && next_random() % 8 == 0);
+	s.ptr = reinterpret_cast<std::uintptr_t>(left ? base : base + page - rounded);
+	s.size = size;
+	s.state = SlotState::Allocated;
+	s.alloc_depth = backtrace(s.alloc_stack, stack_depth);
+	s.free_depth = 0;
+	return reinterpret_cast<void *>(s.ptr);
+}
+
+[[noreturn]] void bad_free(const char *what, std::uintptr_t addr, const Slot &s)
+{
+	describe(what, addr, s);
+	void *stack[stack_depth];
+	put_stack("this free:", stack, backtrace(stack, stack_depth));
+	std::abort();
+}
+
+void guarded_free(void *p)
+{
+	std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(p);
+	std::size_t index = (addr - reinterpret_cast<std::uintptr_t>(pool)) / page;
+	Guard g;
+	if (index % 2 == 0) {
+		put("==guarded_alloc== invalid free of a guard page address ");
+		put_num(addr, 16);
+		put("\n");
+		std::abort();
+	}
+	Slot &s = slots[index / 2];
+	if (s.state == SlotState::Unused || addr != s.ptr)
+		bad_free("invalid free", addr, s);
+	if (s.state == SlotState::Freed)
+		bad_free("double free", addr, s);
+	s.state = SlotState::Freed;
+	s.free_depth = backtrace(s.free_stack, stack_depth);
+	mprotect(slot_page(index / 2), page, PROT_NONE);
+	quarantine[(q_head + q_len) % slot_count] = index / 2;
+	q_len++;
+}
+
+/* What a replaceable operator new must do when the heap is out of memory: call the new handler, or throw. */
+void out_of_memory(void)
+{
+	std::new_handler handler = std::get_new_handler();
+	if (!handler)
+		throw std::bad_alloc();
+	handler();
+}
+
+/* The slow path, taken when this thread's countdown runs out. */
+bool should_sample(Placement &placement)
+{
+	if (init_state.load(std::memory_order_acquire) != 2)
+		init();
+	placement = Placement::Random;
+	if (forced) {
+		forced = false;
+		placement = forced_placement;
+		countdown = 1;
+		return true;
+	}
+	unsigned r = rate.load(std::memory_order_relaxed);
+	countdown = next_countdown(r);
+	return r != 0;
+}
+
+void *allocate(std::size_t size)
+{
+	Placement placement;
+	if (__builtin_expect(--countdown == 0, 0) && should_sample(placement) && pool_ready)
+		if (void *p = guarded_alloc(size, placement))
+			return p;
+	for (;;) {
+		if (void *p = std::malloc(size ? size : 1))
+			return p;
+		out_of_memory();
+	}
+}
+
+void deallocate(void *p) noexcept
+{
+	if (__builtin_expect(in_pool(reinterpret_cast<std::uintptr_t>(p)), 0))
+		guarded_free(p);
+	else
+		std::free(p);
+}
+
+}
+
+void set_sample_rate(unsigned r)
+{
+	if (init_state.load() != 2)
+		init();
+	rate = r;
+	countdown = next_countdown(r);
+}
+
+unsigned sample_rate(void)
+{
+	return rate;
+}
+
+void force_next(Placement placement)
+{
+	forced = true;
+	forced_placement = placement;
+	countdown = 1;
+}
+
+bool is_guarded(const void *p)
+{
+	return in_pool(reinterpret_cast<std::uintptr_t>(p));
+}
+
+}
+
+/*
+ * Replaceable global allocation functions. Over-aligned new goes straight to aligned_alloc(), guarded slots only
+ * promise the default new alignment.
+ */
+void *operator new(std::size_t size) { return guarded_alloc::allocate(size); }
+void *operator new[](std::size_t size) { return guarded_alloc::allocate(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+	try {
+		return guarded_alloc::allocate(size);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept { return operator new(size, tag); }
+
+void operator delete(void *p) noexcept { guarded_alloc::deallocate(p); }
+void operator delete[](void *p) noexcept { guarded_alloc::deallocate(p); }
+void operator delete(void *p, std::size_t) noexcept { guarded_alloc::deallocate(p); }
+void operator delete[](void *p, std::size_t) noexcept { guarded_alloc::deallocate(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { guarded_alloc::deallocate(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { guarded_alloc::deallocate(p); }
+
+void *operator new(std::size_t size, std::align_val_t al)
+{
+	std::size_t a = static_cast<std::size_t>(al);
+	if (size > SIZE_MAX - (a - 1)) // Rounding up would wrap to a tiny block.
+		throw std::bad_alloc();
+	std::size_t rounded = ((size ? size : 1) + a - 1) / a * a; // aligned_alloc() wants a multiple of a.
+	for (;;) {
+		if (void *p = std::aligned_alloc(a, rounded))
+			return p;
+		guarded_alloc::out_of_memory();
+	}
+}
+
+void *operator new[](std::size_t size, std::align_val_t al) { return operator new(size, al); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
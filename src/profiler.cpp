@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <execinfo.h>
+#include <link.h>
+#include <sys/time.h>
+
+#include "profiler.hpp"
+
+namespace profiler {
+
+namespace {
+
+constexpr int max_depth = 48;
+constexpr int skipped_frames = 2; // The handler itself and the kernel's signal trampoline.
+
+struct Sample {
+	int depth;
+	void *pc[max_depth];
+};
+
+std::unique_ptr<Sample[]> samples;
+std::size_t capacity;
+std::atomic<std::size_t> taken{0};
+std::atomic<std::size_t> dropped{0};
+std::atomic<std::int64_t> handler_ns{0};
+
+bool running;
+bool use_posix_timer;
+Clock timer_clock;
+timer_t timer;
+struct sigaction old_action;
+unsigned requested_hz;
+std::int64_t started_ns, stopped_ns;		// CLOCK_MONOTONIC
+std::int64_t started_cpu_ns, stopped_cpu_ns;	// CLOCK_PROCESS_CPUTIME_ID, the clock the timer counts
+
+std::int64_t now_ns(clockid_t clock)
+{
+	timespec ts;
+	clock_gettime(clock, &ts);
+	return static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Only touches memory allocated by start(). backtrace() is not on the POSIX async-signal-safe list because its first
+ * call loads the unwinder. start() makes that first call, after which it only reads unwind tables.
+ */
+void on_sigprof(int)
+{
+	int saved_errno = errno;
+	std::int64_t t0 = now_ns(CLOCK_MONOTONIC);
+	std::size_t i = taken.fetch_add(1, std::memory_order_relaxed);
+	if (i < capacity) {
+		void *pc[max_depth + skipped_frames];
+		int n = backtrace(pc, max_depth + skipped_frames) - skipped_frames;
+		Sample &s = samples[i];
+		s.depth = n > 0 ? n : 0;
+		for (int d = 0; d < s.depth; d++)
+			s.pc[d] = pc[d + skipped_frames];
+	} else {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+	handler_ns.fetch_add(now_ns(CLOCK_MONOTONIC) - t0, std::memory_order_relaxed);
+	errno = saved_errno;
+}
+
+/* Function symbols of one ELF object, read from .symtab (falls back to .dynsym for stripped objects). */
+struct SymbolTable {
+	struct Symbol {
+		std::uintptr_t addr, size;
+		std::string name;
+	};
+	std::vector<Symbol> symbols;
+
+	explicit SymbolTable(const char *path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		std::vector<char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		if (file.size() < sizeof(Elf64_Ehdr) || std::memcmp(file.data(), ELFMAG, SELFMAG) != 0 ||
+				file[EI_CLASS] != ELFCLASS64)
+			return;
+		auto *eh = reinterpret_cast<const Elf64_Ehdr *>(file.data());
+		if (eh->e_shoff + eh->e_shnum * sizeof(Elf64_Shdr) > file.size())
+			return;
+		auto *sh = reinterpret_cast<const Elf64_Shdr *>(file.data() + eh->e_shoff);
+		for (Elf64_Word type : { SHT_SYMTAB, SHT_DYNSYM }) {
+			for (int i = 0; i < eh->e_shnum; i++) {
+				if (sh[i].sh_type != type || sh[i].sh_link >= eh->e_shnum)
+					continue;
+				const Elf64_Shdr &strtab = sh[sh[i].sh_link];
+				if (sh[i].sh_offset + sh[i].sh_size > file.size() ||
+						strtab.sh_offset + strtab.sh_size > file.size())
+					continue;
+				auto *sym = reinterpret_cast<const Elf64_Sym *>(file.data() + sh[i].sh_offset);
+				for (std::size_t k = 0; k < sh[i].sh_size / sizeof(Elf64_Sym); k++)
+					if (ELF64_ST_TYPE(sym[k].st_info) == STT_FUNC && sym[k].st_value &&
+							sym[k].st_name < strtab.sh_size)
+						symbols.push_back({ sym[k].st_value, sym[k].st_size,
+								file.data() + strtab.sh_offset + sym[k].st_name });
+			}
+			if (!symbols.empty())
+				break;
+		}
+		std::sort(symbols.begin(), symbols.end(),
+				[](const Symbol &a, const Symbol &b) { return a.addr < b.addr; });
+	}
+
+	const std::string *find(std::uintptr_t addr) const
+	{
+		auto it = std::upper_bound(symbols.begin(), symbols.end(), addr,
+				[](std::uintptr_t a, const Symbol &s) { return a < s.addr; });
+		if (it == symbols.begin())
+			return nullptr;
+		--it;
+		return addr < it->addr + std::max<std::uintptr_t>(it->size, 1) ? &it->name : nullptr;
+	}
+};
+
+std::string demangle(const std::string &name)
+{
+	int status = 0;
+	char *d = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+	std::string out = status == 0 && d ? d : name;
+	std::free(d);
+	std::replace(out.begin(), out.end(), ';', ':'); // ';' separates frames in the folded format.
+	return out;
+}
+
+class Symbolizer {
+public:
+	std::string name(void *pc)
+	{
+		auto cached = m_names.find(pc);
+		if (cached != m_names.end())
+			return cached->second;
+
+		std::string result;
+		Dl_info info;
+		link_map *map = nullptr;
+		std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(pc);
+		if (dladdr1(pc, &info, reinterpret_cast<void **>(&map), RTLD_DL_LINKMAP) && info.dli_fname) {
+			std::string object = map && map->l_name[0] ? map->l_name : "/proc/self/exe";
+			auto table = m_tables.find(object);
+			if (table == m_tables.end())
+				table = m_tables.emplace(object, SymbolTable(object.c_str())).first;
+			std::uintptr_t rel = addr - (map ? map->l_addr : 0);
+			if (const std::string *sym = table->second.find(rel))
+				result = demangle(*sym);
+			else if (info.dli_sname)
+				result = demangle(info.dli_sname);
+			else
+				result = object.substr(object.find_last_of('/') + 1) + "+0x" + to_hex(rel);
+		} else {
+			result = "0x" + to_hex(addr);
+		}
+		m_names.emplace(pc, result);
+		return result;
+	}
+
+private:
+	static std::string to_hex(std::uintptr_t v)
+	{
+		char buf[2 * sizeof(v) + 1];
+		std::snprintf(buf, sizeof(buf), "%llx", static_cast<unsigned long long>(v));
+		return buf;
+	}
+
+	std::map<std::string, SymbolTable> m_tables;
+	std::map<void *, std::string> m_names;
+};
+
+}
+
+bool start(unsigned hz, Clock clock, std::size_t max_samples)
+{
+	if (running || hz == 0 || hz > max_hz)
+		return false;
+	samples.reset(new Sample[max_samples]); // Not touched until sampled, the pages stay lazily mapped.
+	capacity = max_samples;
+	taken = 0;
+	dropped = 0;
+	handler_ns = 0;
+
+	void *warm[1];
+	backtrace(warm, 1);
+
+	struct sigaction sa = {};
+	sa.sa_handler = on_sigprof;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGPROF, &sa, &old_action) != 0)
+		return false;
+
+	long interval_ns = 1000000000L / hz;
+	sigevent sev = {};
+	sev.sigev_notify = SIGEV_SIGNAL;
+	sev.sigev_signo = SIGPROF;
+	itimerspec its = {};
+	its.it_interval.tv_sec = its.it_value.tv_sec = interval_ns / 1000000000L;
+	its.it_interval.tv_nsec = its.it_value.tv_nsec = interval_ns % 1000000000L;
+	use_posix_timer = timer_create(clock == Clock::Wall ? CLOCK_MONOTONIC : CLOCK_PROCESS_CPUTIME_ID, &sev,
+			&timer) == 0;
+	if (use_posix_timer) {
+		if (timer_settime(timer, 0, &its, nullptr) != 0) {
+			timer_delete(timer);
+			use_posix_timer = false;
+		}
+	}
+	if (!use_posix_timer) {
+		if (clock == Clock::Wall) { // ITIMER_REAL would raise SIGALRM, not SIGPROF.
+			sigaction(SIGPROF, &old_action, nullptr);
+			return false;
+		}
+		itimerval itv = {};
+		itv.it_interval.tv_sec = itv.it_value.tv_sec = its.it_interval.tv_sec;
+		itv.it_interval.tv_usec = itv.it_value.tv_usec = its.it_interval.tv_nsec / 1000;
+		if (setitimer(ITIMER_PROF, &itv, nullptr) != 0) {
+			sigaction(SIGPROF, &old_action, nullptr);
+			return false;
+		}
+	}
+	requested_hz = hz;
+	timer_clock = clock;
+	started_ns = now_ns(CLOCK_MONOTONIC);
+	started_cpu_ns = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+	running = true;
+	return true;
+}
+
+void stop(void)
+{
+	if (!running)
+		return;
+	if (use_posix_timer) {
+		timer_delete(timer);
+	} else {
+		itimerval off = {};
+		setitimer(ITIMER_PROF, &off, nullptr);
+	}
+	sigaction(SIGPROF, &old_action, nullptr);
+	stopped_ns = now_ns(CLOCK_MONOTONIC);
+	stopped_cpu_ns = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+	running = false;
+}
+
+bool write_folded(const char *path)
+{
+	stop();
+	std::size_t n = std::min(taken.load(), capacity);
+	Symbolizer symbolizer;
+	std::map<std::string, std::size_t> stacks;
+	for (std::size_t i = 0; i < n; i++) {
+		const Sample &s = samples[i];
+		std::string stack;
+		for (int d = s.depth - 1; d >= 0; d--) {
+			/* Return addresses point after the call, step back into it. The leaf is the interrupted pc. */
+			char *pc = static_cast<char *>(s.pc[d]) - (d > 0 ? 1 : 0);
+			if (!stack.empty())
+				stack += ';';
+			stack += symbolizer.name(pc);
+		}
+		if (!stack.empty())
+			stacks[stack]++;
+	}
+
+	std::ofstream out(path);
+	for (const auto &entry : stacks)
+		out << entry.first << ' ' << entry.second << '\n';
+	if (!out)
+		return false;
+
+	/*
+	 * Process CPU timers fire on scheduler ticks, so the delivered rate can be far below the requested one. Report
+	 * both, and when they differ give the overhead at the requested rate as what it is: per sample cost times rate,
+	 * not a measurement.
+	 */
+	std::size_t delivered = taken.load();
+	double wall_ms = (stopped_ns - started_ns) / 1e6;
+	double cpu_s = (stopped_cpu_ns - started_cpu_ns) / 1e9;
+	double clock_s = timer_clock == Clock::Wall ? wall_ms / 1e3 : cpu_s;
+	double handler_ms = handler_ns.load() / 1e6;
+	double effective_hz = clock_s > 0 ? delivered / clock_s : 0.0;
+	double per_sample_us = delivered ? 1000.0 * handler_ms / delivered : 0.0;
+	std::cerr << "profile: " << n << " samples (" << dropped.load() << " dropped), " << stacks.size()
+		<< " stacks written to " << path << std::endl;
+	std::cerr << "profile: effective rate " << effective_hz << " Hz of " << requested_hz << " Hz requested ("
+		<< delivered << " samples in " << clock_s * 1000 << " ms of "
+		<< (timer_clock == Clock::Wall ? "wall" : "CPU") << " time)" << std::endl;
+	std::cerr << "profile: handler time " << handler_ms << " ms of " << wall_ms << " ms ("
+		<< (wall_ms > 0 ? 100.0 * handler_ms / wall_ms : 0.0) << "% measured), " << per_sample_us
+		<< " us per sample";
+	if (effective_hz < 0.9 * requested_hz)
+		std::cerr << ", about " << per_sample_us * requested_hz / 1e4 << "% at a true " << requested_hz
+			<< " Hz (extrapolated, --profile-clock=wall measures it)";
+	std::cerr << std::endl;
+	samples.reset();
+	return true;
+}
+
+}